@@ -18,6 +18,7 @@
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
 #include <assert.h>
+#include <string.h>
 
 /* the global Assimp scene object */
 #define _nb_max_item 30
@@ -28,18 +29,41 @@ static struct aiVector3D _scene_min[_nb_max_item], _scene_max[_nb_max_item], _sc
 #define aisgl_min(x,y) (x<y?x:y)
 #define aisgl_max(x,y) (y>x?y:x)
 
+/*!\brief matriau extrait une fois pour toutes de la scne Assimp */
+struct material_t {
+  GLfloat diffuse[4], specular[4], ambient[4], emission[4], shininess;
+  GLuint hasTexture;
+};
+
+/*!\brief lment  dessiner, issu de l'aplatissement de l'arbre des
+ * noeuds : indice de sa matrice monde dans _worlds (normalisation
+ * comprise), VAO, nombre d'indices et matriau. */
+struct draw_item_t {
+  GLuint world, vao, count, material;
+};
+
 static void get_bounding_box_for_node (const struct aiNode* nd, struct aiVector3D* min, struct aiVector3D* max, struct aiMatrix4x4* trafo,GLuint id);
 static void get_bounding_box (struct aiVector3D* min, struct aiVector3D* max,GLuint id);
 static void color4_to_float4(const struct aiColor4D *c, float f[4]);
 static void set_float4(float f[4], float a, float b, float c, float d);
-static void apply_material(const struct aiMaterial *mtl);
+static void get_material(const struct aiMaterial *mtl, struct material_t * m);
+static void apply_material(const struct material_t * m, const GLint * loc);
 static void sceneMkVAOs (const struct aiScene *sc, const struct aiNode* nd, GLuint * ivao,GLuint id);
-static void sceneDrawVAOs(const struct aiScene *sc, const struct aiNode* nd, GLuint * ivao,GLuint id);
+static void sceneFlatten(const struct aiScene *sc, const struct aiNode* nd, struct aiMatrix4x4 * trafo, GLuint * ivao, GLuint id);
 static int  sceneNbMeshes(const struct aiScene *sc, const struct aiNode* nd, int subtotal);
 static int  loadasset (const char* path,GLuint id);
 
 static GLuint * _vaos[_nb_max_item], * _buffers[_nb_max_item], * _counts[_nb_max_item], * _textures[_nb_max_item], _nbMeshes[_nb_max_item], _nbTextures[_nb_max_item];
 
+/*!\brief uniformes des matriaux, localiss une fois par assimpDrawScene */
+enum { U_DIFFUSE = 0, U_SPECULAR, U_AMBIENT, U_EMISSION, U_SHININESS, U_HAS_TEXTURE, U_MY_TEXTURE, U_NB };
+static const char * _uniforms[U_NB] = { "diffuse_color", "specular_color", "ambient_color", "emission_color", "shininess", "hasTexture", "myTexture" };
+
+static struct material_t * _materials[_nb_max_item];
+static struct draw_item_t * _items[_nb_max_item];
+static GLfloat (* _worlds[_nb_max_item])[16];
+static GLuint _nbItems[_nb_max_item], _nbWorlds[_nb_max_item];
+
 
 /*!\brief modification du Assimp.c avec l'ajout d'un id afin de charger plusieurs objets diffrents en mme temps
  *
@@ -49,6 +73,8 @@ static GLuint * _vaos[_nb_max_item], * _buffers[_nb_max_item], * _counts[_nb_max
 void assimpInit(const char * filename, GLuint id) {
   int i;
   GLuint ivao = 0;
+  GLfloat tmp;
+  struct aiMatrix4x4 trafo;
   _scene[id] = NULL;
   _vaos[id] = NULL;
   _buffers[id] = NULL;
@@ -56,6 +82,11 @@ void assimpInit(const char * filename, GLuint id) {
   _textures[id] = NULL;
   _nbMeshes[id] = 0;
   _nbTextures[id] = 0;
+  _materials[id] = NULL;
+  _items[id] = NULL;
+  _worlds[id] = NULL;
+  _nbItems[id] = 0;
+  _nbWorlds[id] = 0;
 
   struct aiLogStream stream;
   /* get a handle to the predefined STDOUT log stream and attach
@@ -84,9 +115,12 @@ void assimpInit(const char * filename, GLuint id) {
   assert(_textures[id]);
   
   glGenTextures(_nbTextures[id], _textures[id]);
+  _materials[id] = malloc(_nbTextures[id] * sizeof *_materials[id]);
+  assert(_materials[id]);
 
   for (i = 0; i < _scene[id]->mNumMaterials ; i++) {
     const struct aiMaterial* pMaterial = _scene[id]->mMaterials[i];
+    get_material(pMaterial, &_materials[id][i]);
     if (aiGetMaterialTextureCount(pMaterial, aiTextureType_DIFFUSE) > 0) {
       struct aiString tfname;
       char * dir = pathOf(filename), buf[BUFSIZ];
@@ -124,18 +158,61 @@ void assimpInit(const char * filename, GLuint id) {
   _counts[id] = calloc(_nbMeshes[id], sizeof *_counts[id]);
   assert(_counts[id]);
   sceneMkVAOs(_scene[id], _scene[id]->mRootNode, &ivao,id);
-}
 
-void assimpDrawScene(GLuint id) {
-  GLfloat tmp;
-  GLuint ivao = 0;
+  /* aplatissement de l'arbre : la normalisation (mise  l'chelle
+     unitaire puis centrage sur la bote englobante) est la matrice
+     racine, chaque noeud porteur de maillages y ajoute sa transformation
+     cumule. */
+  _items[id] = malloc(_nbMeshes[id] * sizeof *_items[id]);
+  assert(!_nbMeshes[id] || _items[id]);
+  _worlds[id] = malloc(_nbMeshes[id] * sizeof *_worlds[id]);
+  assert(!_nbMeshes[id] || _worlds[id]);
   tmp = _scene_max[id].x - _scene_min[id].x;
   tmp = aisgl_max(_scene_max[id].y - _scene_min[id].y, tmp);
   tmp = aisgl_max(_scene_max[id].z - _scene_min[id].z, tmp);
   tmp = 1.0f / tmp;
-  gl4duScalef(tmp, tmp, tmp);
-  gl4duTranslatef( -_scene_center[id].x, -_scene_center[id].y, -_scene_center[id].z);
-  sceneDrawVAOs(_scene[id], _scene[id]->mRootNode, &ivao,id);
+  aiIdentityMatrix4(&trafo);
+  trafo.a1 = trafo.b2 = trafo.c3 = tmp;
+  trafo.a4 = -tmp * _scene_center[id].x;
+  trafo.b4 = -tmp * _scene_center[id].y;
+  trafo.c4 = -tmp * _scene_center[id].z;
+  ivao = 0;
+  sceneFlatten(_scene[id], _scene[id]->mRootNode, &trafo, &ivao, id);
+}
+
+/*!\brief dessine l'objet \a id : simple parcours du tableau produit par
+ * sceneFlatten ; matrices et matriaux ne sont renvoys que lorsqu'ils
+ * changent d'un lment au suivant.
+ */
+void assimpDrawScene(GLuint id) {
+  GLint pId, loc[U_NB];
+  GLuint k, world = (GLuint)-1, material = (GLuint)-1;
+  glGetIntegerv(GL_CURRENT_PROGRAM, &pId);
+  for(k = 0; k < U_NB; ++k)
+    loc[k] = glGetUniformLocation(pId, _uniforms[k]);
+  glUniform1i(loc[U_MY_TEXTURE], 0);
+  for(k = 0; k < _nbItems[id]; ++k) {
+    const struct draw_item_t * it = &_items[id][k];
+    if(it->world != world) {
+      if(world != (GLuint)-1)
+	gl4duPopMatrix();
+      gl4duPushMatrix();
+      gl4duMultMatrixf(_worlds[id][it->world]);
+      gl4duSendMatrices();
+      world = it->world;
+    }
+    if(it->material != material) {
+      material = it->material;
+      apply_material(&_materials[id][material], loc);
+      glBindTexture(GL_TEXTURE_2D, _materials[id][material].hasTexture ? _textures[id][material] : 0);
+    }
+    glBindVertexArray(it->vao);
+    glDrawElements(GL_TRIANGLES, it->count, GL_UNSIGNED_INT, 0);
+  }
+  if(world != (GLuint)-1)
+    gl4duPopMatrix();
+  glBindVertexArray(0);
+  glBindTexture(GL_TEXTURE_2D, 0);
 }
 
 void assimpQuit(void) {
@@ -154,6 +231,19 @@ void assimpQuit(void) {
       free(_counts[id]);
       _counts[id] = NULL;
     }
+    if(_materials[id]) {
+      free(_materials[id]);
+      _materials[id] = NULL;
+    }
+    if(_items[id]) {
+      free(_items[id]);
+      _items[id] = NULL;
+    }
+    if(_worlds[id]) {
+      free(_worlds[id]);
+      _worlds[id] = NULL;
+    }
+    _nbItems[id] = _nbWorlds[id] = 0;
     if(_textures[id]) {
       glDeleteTextures(_nbTextures[id], _textures[id]);
       free(_textures[id]);
@@ -213,49 +303,51 @@ static void set_float4(float f[4], float a, float b, float c, float d) {
   f[0] = a; f[1] = b; f[2] = c; f[3] = d;
 }
 
-static void apply_material(const struct aiMaterial *mtl) {
-  float c[4];
+static void get_material(const struct aiMaterial *mtl, struct material_t * m) {
   unsigned int max;
   float shininess, strength;
   struct aiColor4D diffuse, specular, ambient, emission;
-  GLint id;
-  glGetIntegerv(GL_CURRENT_PROGRAM, &id);
-  
-  set_float4(c, 0.8f, 0.8f, 0.8f, 1.0f);
+
+  set_float4(m->diffuse, 0.8f, 0.8f, 0.8f, 1.0f);
   if (AI_SUCCESS == aiGetMaterialColor(mtl, AI_MATKEY_COLOR_DIFFUSE, &diffuse)){
-    color4_to_float4(&diffuse, c);
+    color4_to_float4(&diffuse, m->diffuse);
   }
-  glUniform4fv(glGetUniformLocation(id, "diffuse_color"), 1, c);
 
-  set_float4(c, 0.0f, 0.0f, 0.0f, 1.0f);
+  set_float4(m->specular, 0.0f, 0.0f, 0.0f, 1.0f);
   if (AI_SUCCESS == aiGetMaterialColor(mtl, AI_MATKEY_COLOR_SPECULAR, &specular)){
-    color4_to_float4(&specular, c);
+    color4_to_float4(&specular, m->specular);
   }
-  glUniform4fv(glGetUniformLocation(id, "specular_color"), 1, c);
 
-  set_float4(c, 0.2f, 0.2f, 0.2f, 1.0f);
+  set_float4(m->ambient, 0.2f, 0.2f, 0.2f, 1.0f);
   if (AI_SUCCESS == aiGetMaterialColor(mtl, AI_MATKEY_COLOR_AMBIENT, &ambient)){
-    color4_to_float4(&ambient, c);
+    color4_to_float4(&ambient, m->ambient);
   }
-  glUniform4fv(glGetUniformLocation(id, "ambient_color"), 1, c);
 
-  set_float4(c, 0.0f, 0.0f, 0.0f, 1.0f);
+  set_float4(m->emission, 0.0f, 0.0f, 0.0f, 1.0f);
   if (AI_SUCCESS == aiGetMaterialColor(mtl, AI_MATKEY_COLOR_EMISSIVE, &emission)){
-    color4_to_float4(&emission, c);
+    color4_to_float4(&emission, m->emission);
   }
-  glUniform4fv(glGetUniformLocation(id, "emission_color"), 1, c);
 
   max = 1;
   if(aiGetMaterialFloatArray(mtl, AI_MATKEY_SHININESS, &shininess, &max) == AI_SUCCESS) {
     max = 1;
     if(aiGetMaterialFloatArray(mtl, AI_MATKEY_SHININESS_STRENGTH, &strength, &max) == AI_SUCCESS)
-      glUniform1f(glGetUniformLocation(id, "shininess"), shininess * strength);
+      m->shininess = shininess * strength;
     else
-	glUniform1f(glGetUniformLocation(id, "shininess"), shininess);
-  } else {
-    shininess = 0.0;
-    glUniform1f(glGetUniformLocation(id, "shininess"), shininess);
-  }
+      m->shininess = shininess;
+  } else
+    m->shininess = 0.0f;
+
+  m->hasTexture = aiGetMaterialTextureCount(mtl, aiTextureType_DIFFUSE) > 0;
+}
+
+static void apply_material(const struct material_t * m, const GLint * loc) {
+  glUniform4fv(loc[U_DIFFUSE], 1, m->diffuse);
+  glUniform4fv(loc[U_SPECULAR], 1, m->specular);
+  glUniform4fv(loc[U_AMBIENT], 1, m->ambient);
+  glUniform4fv(loc[U_EMISSION], 1, m->emission);
+  glUniform1f(loc[U_SHININESS], m->shininess);
+  glUniform1i(loc[U_HAS_TEXTURE], m->hasTexture);
 }
 
 static void sceneMkVAOs(const struct aiScene *sc, const struct aiNode* nd, GLuint * ivao, GLuint id) {
@@ -335,40 +427,34 @@ static void sceneMkVAOs(const struct aiScene *sc, const struct aiNode* nd, GLuin
 }
 
 
-static void sceneDrawVAOs(const struct aiScene *sc, const struct aiNode* nd, GLuint * ivao,GLuint i) {
+/*!\brief range dans _items/_worlds les maillages dessinables du noeud
+ * \a nd et de ses descendants, dans l'ordre de cration des VAO ;
+ * \a trafo est la matrice monde cumule du parent.
+ */
+static void sceneFlatten(const struct aiScene *sc, const struct aiNode* nd, struct aiMatrix4x4 * trafo, GLuint * ivao, GLuint id) {
+  struct aiMatrix4x4 prev = *trafo;
   unsigned int n = 0;
-  struct aiMatrix4x4 m = nd->mTransformation;
-  GLint id;
+  GLuint world = (GLuint)-1;
 
-  glGetIntegerv(GL_CURRENT_PROGRAM, &id);
   /* By VB Inutile de transposer la matrice, gl4dummies fonctionne avec des transpose de GL. */
-  /* aiTransposeMatrix4(&m); */
-  gl4duPushMatrix();
-  gl4duMultMatrixf((GLfloat*)&m);
-  gl4duSendMatrices();
-
-  for (; n < nd->mNumMeshes; ++n) {
-    const struct aiMesh* mesh = sc->mMeshes[nd->mMeshes[n]];
-    if(_counts[i][*ivao]) {
-      glBindVertexArray(_vaos[i][*ivao]);
-      apply_material(sc->mMaterials[mesh->mMaterialIndex]);
-      if (aiGetMaterialTextureCount(sc->mMaterials[mesh->mMaterialIndex], aiTextureType_DIFFUSE) > 0) {
-	glBindTexture(GL_TEXTURE_2D, _textures[i][mesh->mMaterialIndex]);
-	glUniform1i(glGetUniformLocation(id, "hasTexture"), 1);
-	glUniform1i(glGetUniformLocation(id, "myTexture"), 0);
-      } else {
-	glUniform1i(glGetUniformLocation(id, "hasTexture"), 0);
-      }
-      glDrawElements(GL_TRIANGLES, _counts[i][*ivao], GL_UNSIGNED_INT, 0);
-      glBindVertexArray(0);
-      glBindTexture(GL_TEXTURE_2D, 0);
+  aiMultiplyMatrix4(trafo, &nd->mTransformation);
+  for (; n < nd->mNumMeshes; ++n, ++(*ivao)) {
+    struct draw_item_t * it;
+    if(!_counts[id][*ivao]) continue;
+    if(world == (GLuint)-1) {
+      world = _nbWorlds[id]++;
+      memcpy(_worlds[id][world], trafo, sizeof _worlds[id][world]);
     }
-    (*ivao)++;
-  }  
+    it = &_items[id][_nbItems[id]++];
+    it->world = world;
+    it->vao = _vaos[id][*ivao];
+    it->count = _counts[id][*ivao];
+    it->material = sc->mMeshes[nd->mMeshes[n]]->mMaterialIndex;
+  }
   for (n = 0; n < nd->mNumChildren; ++n) {
-    sceneDrawVAOs(sc, nd->mChildren[n], ivao,i);
+    sceneFlatten(sc, nd->mChildren[n], trafo, ivao, id);
   }
-  gl4duPopMatrix(); 
+  *trafo = prev;
 }
 
 static int sceneNbMeshes(const struct aiScene *sc, const struct aiNode* nd, int subtotal) {
@@ -0,0 +1,439 @@
+/*!\file cascade.cpp
+ *
+ * \brief cascades de Haar précompilées.
+ *
+ * Le parcours des .xml OpenCV (près d'1 Mo chacun, licences
+ * comprises) à chaque lancement est remplacé par un fichier binaire
+ * compact (même nom, extension .bin) produit une seule fois puis
+ * projeté en mémoire en lecture seule (MAP_SHARED) : plusieurs
+ * processus partagent ainsi les mêmes pages du cache système. Le
+ * binaire est recompilé dès que la taille ou la date du .xml source
+ * ne correspondent plus à celles enregistrées dans son en-tête. S'il
+ * ne peut pas être écrit (répertoire en lecture seule par exemple), la
+ * cascade compilée est gardée en mémoire.
+ *
+ * Format : un en-tête cascade_header_t suivi de la charge utile,
+ * dans l'ordre : étages, puis pour les classifieurs faibles les
+ * tableaux indice de caractéristique / seuil / feuille gauche /
+ * feuille droite, puis caractéristiques et rectangles. Une somme
+ * FNV-1a 64 bits protège l'en-tête (champ checksum à zéro) puis la
+ * charge utile.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <string>
+#include <vector>
+#include <opencv2/core/core.hpp>
+#include "cascade.h"
+
+using namespace cv;
+using namespace std;
+
+#define CASCADE_MAGIC     "FDCASC\r\n"
+#define CASCADE_VERSION   2
+#define CASCADE_FNV_BASIS 14695981039346656037ULL
+
+/*!\brief en-tête du fichier binaire (72 octets, multiple de 8 ;
+ * reserved est à zéro) */
+typedef struct cascade_header_t {
+  char     magic[8];
+  uint32_t version, headerSize;
+  uint64_t srcSize;
+  int64_t  srcMtime;
+  int32_t  width, height;
+  uint32_t nbStages, nbWeaks, nbFeatures, nbRects, payloadSize, reserved;
+  uint64_t checksum;
+} cascade_header_t;
+
+static uint64_t checksum(const unsigned char * data, size_t size, uint64_t h);
+static uint64_t imageChecksum(const cascade_header_t * h, const unsigned char * payload);
+static size_t   payloadSize(const cascade_header_t * h);
+static string   binName(const char * xmlname);
+static int      validate(const cascade_t * c);
+static int      compile(const char * xmlname, unsigned char ** image, size_t * size);
+static int      writeImage(const char * binname, const unsigned char * image, size_t size);
+static cascade_t * attach(const unsigned char * image, size_t size, const char * name);
+
+/*!\brief somme de contrôle FNV-1a 64 bits de \a data, poursuivie à
+ * partir de \a h (CASCADE_FNV_BASIS pour commencer) */
+static uint64_t checksum(const unsigned char * data, size_t size, uint64_t h) {
+  size_t i;
+  for(i = 0; i < size; ++i) {
+    h ^= data[i];
+    h *= 1099511628211ULL;
+  }
+  return h;
+}
+
+/*!\brief somme de contrôle du binaire : en-tête \a h (avec son champ
+ * checksum à zéro) puis charge utile \a payload */
+static uint64_t imageChecksum(const cascade_header_t * h, const unsigned char * payload) {
+  cascade_header_t hc = *h;
+  hc.checksum = 0;
+  return checksum(payload, h->payloadSize,
+                  checksum((const unsigned char *)&hc, sizeof hc, CASCADE_FNV_BASIS));
+}
+
+/*!\brief taille attendue de la charge utile d'après les effectifs de l'en-tête */
+static size_t payloadSize(const cascade_header_t * h) {
+  return h->nbStages   * sizeof(cascade_stage_t) +
+         h->nbWeaks    * (sizeof(int) + 3 * sizeof(float)) +
+         h->nbFeatures * sizeof(cascade_feature_t) +
+         h->nbRects    * sizeof(cascade_rect_t);
+}
+
+/*!\brief nom du binaire associé à un .xml : "x.xml" donne "x.bin" */
+static string binName(const char * xmlname) {
+  string s(xmlname);
+  size_t dot = s.find_last_of('.'), slash = s.find_last_of('/');
+  if(dot != string::npos && (slash == string::npos || dot > slash))
+    s.erase(dot);
+  return s + ".bin";
+}
+
+/*!\brief vérifie que tous les indices de la cascade restent dans
+ * leurs tableaux ; renvoie 0 si c'est le cas.
+ */
+static int validate(const cascade_t * c) {
+  unsigned int i;
+  if(c->width <= 0 || c->height <= 0 || !c->nbStages)
+    return -1;
+  for(i = 0; i < c->nbStages; ++i)
+    if(c->stages[i].first < 0 || c->stages[i].count <= 0 ||
+       (unsigned int)(c->stages[i].first + c->stages[i].count) > c->nbWeaks)
+      return -1;
+  for(i = 0; i < c->nbWeaks; ++i)
+    if(c->weakFeature[i] < 0 || (unsigned int)c->weakFeature[i] >= c->nbFeatures)
+      return -1;
+  for(i = 0; i < c->nbFeatures; ++i)
+    if(c->features[i].first < 0 || c->features[i].count <= 0 || c->features[i].count > 3 ||
+       (unsigned int)(c->features[i].first + c->features[i].count) > c->nbRects)
+      return -1;
+  /* rectangles dans la fenêtre : haar.cpp découpe l'image en bandes
+     recouvrantes d'une hauteur de fenêtre */
+  for(i = 0; i < c->nbFeatures; ++i) {
+    int j;
+    for(j = c->features[i].first; j < c->features[i].first + c->features[i].count; ++j) {
+      const cascade_rect_t * r = &c->rects[j];
+      if(r->x < 0 || r->y < 0 || r->w <= 0 || r->h <= 0)
+        return -1;
+      if(c->features[i].tilted ?
+         r->x - r->h < 0 || r->x + r->w > c->width || r->y + r->w + r->h > c->height :
+         r->x + r->w > c->width || r->y + r->h > c->height)
+        return -1;
+    }
+  }
+  return 0;
+}
+
+/*!\brief compile une cascade OpenCV (.xml, format "opencv-cascade-classifier",
+ * BOOST/HAAR à souches) en mémoire : \a *image reçoit l'en-tête suivi
+ * de la charge utile (\a *size octets, à libérer avec free).
+ *
+ * \return 0 en cas de succès, -1 sinon (message sur stderr).
+ */
+static int compile(const char * xmlname, unsigned char ** image, size_t * size) {
+  cascade_header_t h;
+  vector<cascade_stage_t> stages;
+  vector<int> weakFeature;
+  vector<float> weakThreshold, weakLeft, weakRight;
+  vector<cascade_feature_t> features;
+  vector<cascade_rect_t> rects;
+  vector<unsigned char> payload;
+  struct stat st;
+  FileStorage fs;
+  FileNode root, fn;
+  FileNodeIterator it, it1;
+  size_t off = 0;
+
+  if(stat(xmlname, &st) != 0) {
+    fprintf(stderr, "Cascade %s introuvable\n", xmlname);
+    return -1;
+  }
+  try {
+    fs.open(xmlname, FileStorage::READ);
+  } catch(const cv::Exception & e) {
+    fprintf(stderr, "Erreur lors de la lecture de la cascade %s : %s\n", xmlname, e.what());
+    return -1;
+  }
+  if(!fs.isOpened() || (root = fs.getFirstTopLevelNode()).empty()) {
+    fprintf(stderr, "Impossible d'ouvrir la cascade %s\n", xmlname);
+    return -1;
+  }
+  if((string)root["stageType"] != "BOOST" || (string)root["featureType"] != "HAAR") {
+    fprintf(stderr, "Cascade %s : seules les cascades BOOST/HAAR (nouveau format OpenCV) sont prises en charge\n", xmlname);
+    return -1;
+  }
+  memset(&h, 0, sizeof h);
+  memcpy(h.magic, CASCADE_MAGIC, sizeof h.magic);
+  h.version = CASCADE_VERSION;
+  h.headerSize = sizeof h;
+  h.srcSize = (uint64_t)st.st_size;
+  h.srcMtime = (int64_t)st.st_mtime;
+  h.width = (int)root["width"];
+  h.height = (int)root["height"];
+
+  fn = root["stages"];
+  for(it = fn.begin(); it != fn.end(); ++it) {
+    cascade_stage_t s;
+    FileNode fnw = (*it)["weakClassifiers"];
+    s.first = (int)weakFeature.size();
+    s.threshold = (float)(*it)["stageThreshold"];
+    for(it1 = fnw.begin(); it1 != fnw.end(); ++it1) {
+      FileNode in = (*it1)["internalNodes"], lv = (*it1)["leafValues"];
+      if(in.size() != 4 || lv.size() != 2 || (int)in[0] != 0 || (int)in[1] != -1) {
+        fprintf(stderr, "Cascade %s : seuls les classifieurs faibles à une seule coupure sont pris en charge\n", xmlname);
+        return -1;
+      }
+      weakFeature.push_back((int)in[2]);
+      weakThreshold.push_back((float)in[3]);
+      weakLeft.push_back((float)lv[0]);
+      weakRight.push_back((float)lv[1]);
+    }
+    s.count = (int)weakFeature.size() - s.first;
+    stages.push_back(s);
+  }
+
+  fn = root["features"];
+  for(it = fn.begin(); it != fn.end(); ++it) {
+    cascade_feature_t ft;
+    FileNode fr = (*it)["rects"];
+    ft.first = (int)rects.size();
+    ft.tilted = (int)(*it)["tilted"] != 0;
+    for(it1 = fr.begin(); it1 != fr.end(); ++it1) {
+      cascade_rect_t r;
+      FileNodeIterator v = (*it1).begin();
+      v >> r.x >> r.y >> r.w >> r.h >> r.weight;
+      rects.push_back(r);
+    }
+    ft.count = (int)rects.size() - ft.first;
+    features.push_back(ft);
+  }
+
+  h.nbStages = stages.size();
+  h.nbWeaks = weakFeature.size();
+  h.nbFeatures = features.size();
+  h.nbRects = rects.size();
+
+  {
+    cascade_t c;
+    memset(&c, 0, sizeof c);
+    c.width = h.width; c.height = h.height;
+    c.nbStages = h.nbStages; c.nbWeaks = h.nbWeaks;
+    c.nbFeatures = h.nbFeatures; c.nbRects = h.nbRects;
+    c.stages = stages.empty() ? NULL : &stages[0];
+    c.weakFeature = weakFeature.empty() ? NULL : &weakFeature[0];
+    c.features = features.empty() ? NULL : &features[0];
+    c.rects = rects.empty() ? NULL : &rects[0];
+    if(validate(&c) != 0) {
+      fprintf(stderr, "Cascade %s incohérente (étages, caractéristiques ou rectangles)\n", xmlname);
+      return -1;
+    }
+  }
+
+  h.payloadSize = payloadSize(&h);
+  payload.resize(h.payloadSize);
+#define APPEND(v) if(!v.empty()) { memcpy(&payload[off], &v[0], v.size() * sizeof v[0]); off += v.size() * sizeof v[0]; }
+  APPEND(stages);
+  APPEND(weakFeature);
+  APPEND(weakThreshold);
+  APPEND(weakLeft);
+  APPEND(weakRight);
+  APPEND(features);
+  APPEND(rects);
+#undef APPEND
+  h.checksum = imageChecksum(&h, &payload[0]);
+
+  *size = sizeof h + payload.size();
+  *image = (unsigned char *)malloc(*size);
+  assert(*image);
+  memcpy(*image, &h, sizeof h);
+  memcpy(*image + sizeof h, &payload[0], payload.size());
+  return 0;
+}
+
+/*!\brief écrit le binaire \a binname ; le fichier est écrit sous un nom
+ * temporaire puis renommé : un autre processus ne voit jamais de
+ * binaire partiellement écrit.
+ *
+ * \return 0 en cas de succès, -1 sinon (message sur stderr).
+ */
+static int writeImage(const char * binname, const unsigned char * image, size_t size) {
+  string tmpname = string(binname) + ".tmp." + to_string((long)getpid());
+  FILE * f;
+  if(!(f = fopen(tmpname.c_str(), "wb"))) {
+    fprintf(stderr, "Impossible de créer %s\n", tmpname.c_str());
+    return -1;
+  }
+  if(fwrite(image, size, 1, f) != 1) {
+    fprintf(stderr, "Erreur lors de l'écriture de %s\n", tmpname.c_str());
+    fclose(f);
+    remove(tmpname.c_str());
+    return -1;
+  }
+  if(fclose(f) != 0 || rename(tmpname.c_str(), binname) != 0) {
+    fprintf(stderr, "Erreur lors de l'écriture de %s\n", binname);
+    remove(tmpname.c_str());
+    return -1;
+  }
+  return 0;
+}
+
+/*!\brief compile la cascade \a xmlname vers le binaire \a binname.
+ *
+ * \return 0 en cas de succès, -1 sinon (message sur stderr).
+ */
+int cascadeCompile(const char * xmlname, const char * binname) {
+  unsigned char * image;
+  size_t size;
+  int r;
+  if(compile(xmlname, &image, &size) != 0)
+    return -1;
+  r = writeImage(binname, image, size);
+  free(image);
+  return r;
+}
+
+/*!\brief vérifie l'en-tête, la somme de contrôle et la cohérence des
+ * indices du binaire \a image (\a size octets, issu de \a name) et
+ * crée la cascade qui pointe dans ses tableaux.
+ *
+ * \return la cascade (map et mapped restent à renseigner) ou NULL en
+ * cas d'erreur (message sur stderr).
+ */
+static cascade_t * attach(const unsigned char * image, size_t size, const char * name) {
+  const cascade_header_t * h = (const cascade_header_t *)image;
+  const unsigned char * p;
+  cascade_t * c;
+
+  if(size < sizeof *h || memcmp(h->magic, CASCADE_MAGIC, sizeof h->magic) != 0 ||
+     h->version != CASCADE_VERSION || h->headerSize != sizeof *h || h->reserved != 0) {
+    fprintf(stderr, "%s n'est pas une cascade binaire (ou version différente)\n", name);
+    return NULL;
+  }
+  if(h->payloadSize != payloadSize(h) || sizeof *h + h->payloadSize != size) {
+    fprintf(stderr, "Cascade binaire %s : taille incohérente\n", name);
+    return NULL;
+  }
+  p = image + sizeof *h;
+  if(imageChecksum(h, p) != h->checksum) {
+    fprintf(stderr, "Cascade binaire %s : somme de contrôle invalide\n", name);
+    return NULL;
+  }
+  c = (cascade_t *)calloc(1, sizeof *c);
+  assert(c);
+  c->width = h->width;
+  c->height = h->height;
+  c->nbStages = h->nbStages;
+  c->nbWeaks = h->nbWeaks;
+  c->nbFeatures = h->nbFeatures;
+  c->nbRects = h->nbRects;
+  c->stages = (const cascade_stage_t *)p;        p += h->nbStages * sizeof *c->stages;
+  c->weakFeature = (const int *)p;               p += h->nbWeaks * sizeof *c->weakFeature;
+  c->weakThreshold = (const float *)p;           p += h->nbWeaks * sizeof *c->weakThreshold;
+  c->weakLeft = (const float *)p;                p += h->nbWeaks * sizeof *c->weakLeft;
+  c->weakRight = (const float *)p;               p += h->nbWeaks * sizeof *c->weakRight;
+  c->features = (const cascade_feature_t *)p;    p += h->nbFeatures * sizeof *c->features;
+  c->rects = (const cascade_rect_t *)p;
+  if(validate(c) != 0) {
+    fprintf(stderr, "Cascade binaire %s incohérente\n", name);
+    free(c);
+    return NULL;
+  }
+  return c;
+}
+
+/*!\brief projette en mémoire le binaire \a binname et en vérifie
+ * l'en-tête, la somme de contrôle et la cohérence des indices.
+ *
+ * \return la cascade (à libérer avec cascadeFree) ou NULL en cas
+ * d'erreur (message sur stderr).
+ */
+cascade_t * cascadeMap(const char * binname) {
+  cascade_t * c;
+  struct stat st;
+  void * map;
+  int fd;
+
+  if((fd = open(binname, O_RDONLY)) < 0)
+    return NULL;
+  if(fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(cascade_header_t)) {
+    fprintf(stderr, "Cascade binaire %s tronquée\n", binname);
+    close(fd);
+    return NULL;
+  }
+  map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if(map == MAP_FAILED) {
+    fprintf(stderr, "Impossible de projeter %s en mémoire\n", binname);
+    return NULL;
+  }
+  if(!(c = attach((const unsigned char *)map, st.st_size, binname))) {
+    munmap(map, st.st_size);
+    return NULL;
+  }
+  c->map = map;
+  c->mapSize = st.st_size;
+  c->mapped = 1;
+  return c;
+}
+
+/*!\brief charge la cascade associée à \a xmlname depuis son binaire,
+ * en (re)compilant ce dernier s'il est absent, invalide ou périmé. Si
+ * le .xml est absent, le binaire seul suffit ; si le binaire ne peut
+ * pas être écrit, la cascade compilée est gardée en mémoire.
+ *
+ * \return la cascade (à libérer avec cascadeFree) ou NULL.
+ */
+cascade_t * cascadeLoad(const char * xmlname) {
+  string bin = binName(xmlname);
+  struct stat st;
+  cascade_t * c;
+  unsigned char * image;
+  size_t size;
+  int hasXml = stat(xmlname, &st) == 0;
+
+  if((c = cascadeMap(bin.c_str()))) {
+    const cascade_header_t * h = (const cascade_header_t *)c->map;
+    if(!hasXml || (h->srcSize == (uint64_t)st.st_size && h->srcMtime == (int64_t)st.st_mtime))
+      return c;
+    cascadeFree(c);
+  }
+  if(!hasXml) {
+    fprintf(stderr, "Cascade %s introuvable (ni %s)\n", xmlname, bin.c_str());
+    return NULL;
+  }
+  if(compile(xmlname, &image, &size) != 0)
+    return NULL;
+  if(writeImage(bin.c_str(), image, size) == 0 && (c = cascadeMap(bin.c_str()))) {
+    free(image);
+    return c;
+  }
+  fprintf(stderr, "Cascade %s gardée en mémoire (%s non enregistré)\n", xmlname, bin.c_str());
+  if(!(c = attach(image, size, xmlname))) {
+    free(image);
+    return NULL;
+  }
+  c->map = image;
+  c->mapSize = size;
+  c->mapped = 0;
+  return c;
+}
+
+/*!\brief libère une cascade obtenue par cascadeMap ou cascadeLoad */
+void cascadeFree(cascade_t * c) {
+  if(!c) return;
+  if(c->mapped)
+    munmap(c->map, c->mapSize);
+  else
+    free(c->map);
+  free(c);
+}
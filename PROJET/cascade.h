@@ -0,0 +1,56 @@
+/*!\file cascade.h
+ *
+ * \brief cascades de Haar précompilées : compilation des .xml OpenCV
+ * vers un format binaire compact, projeté en mémoire (mmap) au
+ * démarrage et validé par une somme de contrôle.
+ */
+
+#ifndef _CASCADE_H
+
+#define _CASCADE_H
+
+#include <stddef.h>
+
+/*!\brief un étage du boosting : ses classifieurs faibles sont
+ * cascade_t::weakFeature[first .. first + count - 1] */
+typedef struct cascade_stage_t {
+  int first, count;
+  float threshold;
+} cascade_stage_t;
+
+/*!\brief une caractéristique de Haar : rectangles
+ * cascade_t::rects[first .. first + count - 1] */
+typedef struct cascade_feature_t {
+  int first, count, tilted;
+} cascade_feature_t;
+
+/*!\brief un rectangle pondéré d'une caractéristique de Haar */
+typedef struct cascade_rect_t {
+  int x, y, w, h;
+  float weight;
+} cascade_rect_t;
+
+/*!\brief cascade projetée en mémoire ; tous les pointeurs désignent
+ * directement le contenu du fichier binaire (lecture seule), ou de sa
+ * copie en mémoire s'il n'a pas pu être écrit (mapped à 0). Les
+ * classifieurs faibles (souches) sont rangés étage par étage, en
+ * tableaux séparés. */
+typedef struct cascade_t {
+  int width, height;
+  unsigned int nbStages, nbWeaks, nbFeatures, nbRects;
+  const cascade_stage_t * stages;
+  const int * weakFeature;
+  const float * weakThreshold, * weakLeft, * weakRight;
+  const cascade_feature_t * features;
+  const cascade_rect_t * rects;
+  void * map;
+  size_t mapSize;
+  int mapped;
+} cascade_t;
+
+extern int         cascadeCompile(const char * xmlname, const char * binname);
+extern cascade_t * cascadeMap(const char * binname);
+extern cascade_t * cascadeLoad(const char * xmlname);
+extern void        cascadeFree(cascade_t * c);
+
+#endif
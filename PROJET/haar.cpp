@@ -0,0 +1,706 @@
+/*!\file haar.cpp
+ *
+ * \brief évaluation vectorisée des cascades de Haar.
+ *
+ * Reprend pas à pas CascadeClassifier::detectMultiScale (cascades
+ * BOOST/HAAR à souches) : mêmes échelles, même réduction de l'image,
+ * mêmes images intégrales 32 bits, même normalisation par la variance,
+ * même règle de saut après un rejet au premier étage, mêmes calculs
+ * flottants (somme des feuilles en double) et même regroupement
+ * final. Seule l'évaluation de la cascade change : au lieu d'une
+ * fenêtre à la fois, chaque étage est évalué sur toutes les fenêtres
+ * encore en lice (position et facteur de normalisation rangés en
+ * tableaux séparés), 8 (AVX2) ou 4 (SSE2, NEON) à la fois, puis les
+ * survivantes sont compactées avant l'étage suivant ; les voies
+ * rejetées ne coûtent donc plus rien.
+ *
+ * Les classifieurs faibles sont recopiés étage par étage dans un
+ * tableau continu où chacun porte directement les décalages de ses
+ * rectangles dans l'image intégrale (plus d'indirection par indice de
+ * caractéristique) ; ces décalages ne dépendent que du pas de l'image
+ * intégrale, commun à toutes les échelles.
+ *
+ * Le noyau est choisi à l'exécution ; la variable d'environnement
+ * HAAR_KERNEL (scalar, sse2, avx2, neon) permet d'en imposer un.
+ *
+ * Avec une réserve de threads (haarSetPool), l'image est d'abord
+ * passée en niveaux de gris par bandes de lignes, puis chaque niveau
+ * de la pyramide est une tâche (réduction de l'image, sauf à l'échelle
+ * 1 où elle est lue en place) qui pousse à son tour ses bandes
+ * horizontales (images intégrales de la bande, puis cascade), que les
+ * participants inoccupés se volent. L'intégrale
+ * d'une bande couvre ses origines de fenêtres plus la hauteur d'une
+ * fenêtre : les bandes voisines se recouvrent de cette hauteur, les
+ * sommes de rectangles y sont exactement celles de l'image entière et
+ * aucune fenêtre n'est perdue ni comptée deux fois. Les bandes
+ * couvrent toute la largeur, la règle de saut d'OpenCV enchaînant les
+ * fenêtres d'une même ligne. Les détections sont rassemblées dans
+ * l'ordre (niveau, bande) avant regroupement : le résultat ne dépend
+ * pas de l'ordonnancement.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+#include <limits.h>
+#include <algorithm>
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+#include <opencv2/objdetect.hpp>
+#include "haar.h"
+#include "pool.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#  define HAAR_X86 1
+#  include <immintrin.h>
+#elif defined(__aarch64__)
+#  define HAAR_NEON 1
+#  include <arm_neon.h>
+#endif
+
+/* interpolation de la pyramide : OpenCV (FeatureEvaluator::setImage)
+   réduit l'image en INTER_LINEAR_EXACT depuis l'arrivée du
+   redimensionnement bit à bit (3.4.1), en INTER_LINEAR avant */
+#if CV_VERSION_MAJOR > 3 || (CV_VERSION_MAJOR == 3 && (CV_VERSION_MINOR > 4 || \
+    (CV_VERSION_MINOR == 4 && CV_VERSION_REVISION >= 1)))
+#  define HAAR_INTER INTER_LINEAR_EXACT
+#else
+#  define HAAR_INTER INTER_LINEAR
+#endif
+
+/* découpage en bandes avec une réserve : hauteur minimale d'une bande
+   en hauteurs de fenêtre (le recouvrement d'une hauteur de fenêtre
+   reste ainsi sous 1 / (HAAR_BAND_MIN + 1) des lignes intégrées, coût
+   faible devant celui de la cascade) ; nombre de bandes visé par
+   participant sur toute la pyramide. */
+#ifndef HAAR_BAND_MIN
+#  define HAAR_BAND_MIN 2
+#endif
+#ifndef HAAR_BANDS_PER_THREAD
+#  define HAAR_BANDS_PER_THREAD 8
+#endif
+
+using namespace cv;
+using namespace std;
+
+/*!\brief classifieur faible prêt à l'emploi : décalages des 4 coins
+ * de chaque rectangle (dans l'image intégrale droite ou inclinée),
+ * poids, seuil et feuilles */
+typedef struct haar_weak_t {
+  int ofs[3][4];
+  float weight[3];
+  float threshold, left, right;
+  int nbRects, tilted;
+} haar_weak_t;
+
+/*!\brief étage : classifieurs faibles haar_t::weaks[first .. first + count - 1] */
+typedef struct haar_stage_t {
+  int first, count;
+  float threshold;
+} haar_stage_t;
+
+/*!\brief niveau de la pyramide : image réduite et ses bandes
+ * haar_t::bands[firstBand .. firstBand + nbBands - 1] */
+typedef struct haar_level_t {
+  haar_t * h;
+  float scale;
+  Size sz;
+  Mat img;
+  int shared, firstBand, nbBands;
+} haar_level_t;
+
+/*!\brief bande horizontale d'un niveau : fenêtres dont l'origine est
+ * sur les lignes y0 <= y < y1, et leurs détections */
+typedef struct haar_band_t {
+  haar_t * h;
+  int level, y0, y1;
+  vector<Rect> objects;
+} haar_band_t;
+
+/*!\brief bande de lignes y0 <= y < y1 de l'image à passer en niveaux de gris */
+typedef struct haar_stripe_t {
+  haar_t * h;
+  const Mat * image;
+  int y0, y1;
+} haar_stripe_t;
+
+/*!\brief mémoire de travail d'un participant (images intégrales d'une
+ * bande, fenêtres en lice) */
+typedef struct haar_scratch_t {
+  vector<int> sum, sqsum, tilted;
+  vector<int> ofs[2];
+  vector<float> vnf[2];
+  vector<unsigned char> valid, pass;
+} haar_scratch_t;
+
+struct haar_t {
+  const cascade_t * c;
+  int step, hasTilted, nofs[4];
+  double area;
+  vector<haar_weak_t> weaks;
+  vector<haar_stage_t> stages;
+  Mat gray, grayBuf;
+  pool_t * pool;
+  vector<haar_stripe_t> stripes;
+  vector<haar_level_t> levels;
+  vector<haar_band_t> bands;
+  vector<haar_scratch_t> scratch;
+};
+
+/*!\brief évalue l'étage \a st sur les \a n fenêtres de décalages \a ofs
+ * et de facteurs de normalisation \a vnf ; pass[i] reçoit 1 si la
+ * fenêtre i franchit l'étage. */
+typedef void (*haar_stage_fn_t)(const haar_t * h, const haar_stage_t * st, const int * sum, const int * tilted,
+                                const int * ofs, const float * vnf, int n, unsigned char * pass);
+
+static void selectKernel(void);
+static void compileWeaks(haar_t * h, int step);
+static void grayTask(void * arg);
+static void levelTask(void * arg);
+static void bandTask(void * arg);
+static void stageScalar(const haar_t * h, const haar_stage_t * st, const int * sum, const int * tilted,
+                        const int * ofs, const float * vnf, int n, unsigned char * pass);
+
+static haar_stage_fn_t _stage = NULL;
+static const char * _kernel = NULL;
+
+/*!\brief somme d'un rectangle à partir de ses 4 coins ; l'arithmétique
+ * modulo 2^32 rend le résultat exact même si l'intégrale déborde. */
+static inline int rectSum(const int * p, const int * o) {
+  return (int)((unsigned)p[o[0]] - (unsigned)p[o[1]] - (unsigned)p[o[2]] + (unsigned)p[o[3]]);
+}
+
+/*!\brief valeur d'une caractéristique, dans l'ordre des opérations d'OpenCV */
+static inline float featureValue(const haar_weak_t * w, const int * sum, const int * tilted, int b) {
+  const int * p = (w->tilted ? tilted : sum) + b;
+  float v = w->weight[0] * rectSum(p, w->ofs[0]) + w->weight[1] * rectSum(p, w->ofs[1]);
+  if(w->nbRects > 2)
+    v += w->weight[2] * rectSum(p, w->ofs[2]);
+  return v;
+}
+
+static void stageScalar(const haar_t * h, const haar_stage_t * st, const int * sum, const int * tilted,
+                        const int * ofs, const float * vnf, int n, unsigned char * pass) {
+  const haar_weak_t * w0 = &h->weaks[st->first], * we = w0 + st->count, * w;
+  int i;
+  for(i = 0; i < n; ++i) {
+    double tmp = 0;
+    for(w = w0; w < we; ++w) {
+      float v = featureValue(w, sum, tilted, ofs[i]) * vnf[i];
+      tmp += v < w->threshold ? w->left : w->right;
+    }
+    pass[i] = !(tmp < st->threshold);
+  }
+}
+
+#ifdef HAAR_X86
+#  ifdef __SSE2__
+static inline __m128 rectSum4(const int * img, const int * b, const int * o) {
+  int s[4], k;
+  for(k = 0; k < 4; ++k)
+    s[k] = rectSum(img + b[k], o);
+  return _mm_cvtepi32_ps(_mm_loadu_si128((const __m128i *)s));
+}
+
+static void stageSSE2(const haar_t * h, const haar_stage_t * st, const int * sum, const int * tilted,
+                      const int * ofs, const float * vnf, int n, unsigned char * pass) {
+  const haar_weak_t * w0 = &h->weaks[st->first], * we = w0 + st->count, * w;
+  const __m128d thr = _mm_set1_pd(st->threshold);
+  int i, k;
+  for(i = 0; i < n; i += 4) {
+    int m = min(4, n - i), b[4], mask;
+    float f[4];
+    __m128 nf;
+    __m128d lo = _mm_setzero_pd(), hi = _mm_setzero_pd();
+    /* voies en trop : répétition de la première fenêtre, ignorée ensuite */
+    for(k = 0; k < 4; ++k) {
+      b[k] = ofs[i + (k < m ? k : 0)];
+      f[k] = vnf[i + (k < m ? k : 0)];
+    }
+    nf = _mm_loadu_ps(f);
+    for(w = w0; w < we; ++w) {
+      const int * img = w->tilted ? tilted : sum;
+      __m128 v, lt, leaf;
+      v = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(w->weight[0]), rectSum4(img, b, w->ofs[0])),
+                     _mm_mul_ps(_mm_set1_ps(w->weight[1]), rectSum4(img, b, w->ofs[1])));
+      if(w->nbRects > 2)
+        v = _mm_add_ps(v, _mm_mul_ps(_mm_set1_ps(w->weight[2]), rectSum4(img, b, w->ofs[2])));
+      v = _mm_mul_ps(v, nf);
+      lt = _mm_cmplt_ps(v, _mm_set1_ps(w->threshold));
+      leaf = _mm_or_ps(_mm_and_ps(lt, _mm_set1_ps(w->left)), _mm_andnot_ps(lt, _mm_set1_ps(w->right)));
+      lo = _mm_add_pd(lo, _mm_cvtps_pd(leaf));
+      hi = _mm_add_pd(hi, _mm_cvtps_pd(_mm_movehl_ps(leaf, leaf)));
+    }
+    mask = _mm_movemask_pd(_mm_cmpnlt_pd(lo, thr)) | (_mm_movemask_pd(_mm_cmpnlt_pd(hi, thr)) << 2);
+    for(k = 0; k < m; ++k)
+      pass[i + k] = (mask >> k) & 1;
+  }
+}
+#  endif
+
+__attribute__((target("avx2")))
+static inline __m256 rectSum8(const int * img, __m256i b, const int * o) {
+  __m256i p0 = _mm256_i32gather_epi32(img, _mm256_add_epi32(b, _mm256_set1_epi32(o[0])), 4);
+  __m256i p1 = _mm256_i32gather_epi32(img, _mm256_add_epi32(b, _mm256_set1_epi32(o[1])), 4);
+  __m256i p2 = _mm256_i32gather_epi32(img, _mm256_add_epi32(b, _mm256_set1_epi32(o[2])), 4);
+  __m256i p3 = _mm256_i32gather_epi32(img, _mm256_add_epi32(b, _mm256_set1_epi32(o[3])), 4);
+  return _mm256_cvtepi32_ps(_mm256_add_epi32(_mm256_sub_epi32(_mm256_sub_epi32(p0, p1), p2), p3));
+}
+
+__attribute__((target("avx2")))
+static void stageAVX2(const haar_t * h, const haar_stage_t * st, const int * sum, const int * tilted,
+                      const int * ofs, const float * vnf, int n, unsigned char * pass) {
+  const haar_weak_t * w0 = &h->weaks[st->first], * we = w0 + st->count, * w;
+  const __m256d thr = _mm256_set1_pd(st->threshold);
+  int i, k;
+  for(i = 0; i < n; i += 8) {
+    int m = min(8, n - i), b[8], mask;
+    float f[8];
+    __m256i vb;
+    __m256 nf;
+    __m256d lo = _mm256_setzero_pd(), hi = _mm256_setzero_pd();
+    for(k = 0; k < 8; ++k) {
+      b[k] = ofs[i + (k < m ? k : 0)];
+      f[k] = vnf[i + (k < m ? k : 0)];
+    }
+    vb = _mm256_loadu_si256((const __m256i *)b);
+    nf = _mm256_loadu_ps(f);
+    for(w = w0; w < we; ++w) {
+      const int * img = w->tilted ? tilted : sum;
+      __m256 v, leaf;
+      /* pas de FMA : mêmes arrondis que l'évaluation d'OpenCV */
+      v = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(w->weight[0]), rectSum8(img, vb, w->ofs[0])),
+                        _mm256_mul_ps(_mm256_set1_ps(w->weight[1]), rectSum8(img, vb, w->ofs[1])));
+      if(w->nbRects > 2)
+        v = _mm256_add_ps(v, _mm256_mul_ps(_mm256_set1_ps(w->weight[2]), rectSum8(img, vb, w->ofs[2])));
+      v = _mm256_mul_ps(v, nf);
+      leaf = _mm256_blendv_ps(_mm256_set1_ps(w->right), _mm256_set1_ps(w->left),
+                              _mm256_cmp_ps(v, _mm256_set1_ps(w->threshold), _CMP_LT_OQ));
+      lo = _mm256_add_pd(lo, _mm256_cvtps_pd(_mm256_castps256_ps128(leaf)));
+      hi = _mm256_add_pd(hi, _mm256_cvtps_pd(_mm256_extractf128_ps(leaf, 1)));
+    }
+    mask = _mm256_movemask_pd(_mm256_cmp_pd(lo, thr, _CMP_NLT_UQ)) |
+           (_mm256_movemask_pd(_mm256_cmp_pd(hi, thr, _CMP_NLT_UQ)) << 4);
+    for(k = 0; k < m; ++k)
+      pass[i + k] = (mask >> k) & 1;
+  }
+}
+#endif
+
+#ifdef HAAR_NEON
+static inline float32x4_t rectSum4(const int * img, const int * b, const int * o) {
+  int s[4], k;
+  for(k = 0; k < 4; ++k)
+    s[k] = rectSum(img + b[k], o);
+  return vcvtq_f32_s32(vld1q_s32(s));
+}
+
+static void stageNEON(const haar_t * h, const haar_stage_t * st, const int * sum, const int * tilted,
+                      const int * ofs, const float * vnf, int n, unsigned char * pass) {
+  const haar_weak_t * w0 = &h->weaks[st->first], * we = w0 + st->count, * w;
+  const float64x2_t thr = vdupq_n_f64(st->threshold);
+  int i, k;
+  for(i = 0; i < n; i += 4) {
+    int m = min(4, n - i), b[4];
+    unsigned long long r[4];
+    float f[4];
+    float32x4_t nf;
+    float64x2_t lo = vdupq_n_f64(0), hi = vdupq_n_f64(0);
+    for(k = 0; k < 4; ++k) {
+      b[k] = ofs[i + (k < m ? k : 0)];
+      f[k] = vnf[i + (k < m ? k : 0)];
+    }
+    nf = vld1q_f32(f);
+    for(w = w0; w < we; ++w) {
+      const int * img = w->tilted ? tilted : sum;
+      float32x4_t v, leaf;
+      v = vaddq_f32(vmulq_n_f32(rectSum4(img, b, w->ofs[0]), w->weight[0]),
+                    vmulq_n_f32(rectSum4(img, b, w->ofs[1]), w->weight[1]));
+      if(w->nbRects > 2)
+        v = vaddq_f32(v, vmulq_n_f32(rectSum4(img, b, w->ofs[2]), w->weight[2]));
+      v = vmulq_f32(v, nf);
+      leaf = vbslq_f32(vcltq_f32(v, vdupq_n_f32(w->threshold)), vdupq_n_f32(w->left), vdupq_n_f32(w->right));
+      lo = vaddq_f64(lo, vcvt_f64_f32(vget_low_f32(leaf)));
+      hi = vaddq_f64(hi, vcvt_high_f64_f32(leaf));
+    }
+    vst1q_u64(r, vcltq_f64(lo, thr));
+    vst1q_u64(r + 2, vcltq_f64(hi, thr));
+    for(k = 0; k < m; ++k)
+      pass[i + k] = !r[k];
+  }
+}
+#endif
+
+/*!\brief choisit le noyau le plus large disponible sur la machine, ou
+ * celui imposé par HAAR_KERNEL s'il est disponible. */
+static void selectKernel(void) {
+  const char * env = getenv("HAAR_KERNEL");
+  static const struct { const char * name; haar_stage_fn_t fn; } kernels[] = {
+#ifdef HAAR_X86
+    { "avx2", stageAVX2 },
+#  ifdef __SSE2__
+    { "sse2", stageSSE2 },
+#  endif
+#endif
+#ifdef HAAR_NEON
+    { "neon", stageNEON },
+#endif
+    { "scalar", stageScalar }
+  };
+  size_t i, n = sizeof kernels / sizeof *kernels;
+  for(i = 0; i < n; ++i) {
+#ifdef HAAR_X86
+    if(kernels[i].fn == stageAVX2 && !__builtin_cpu_supports("avx2"))
+      continue;
+#endif
+    if(env && strcmp(env, kernels[i].name))
+      continue;
+    _stage = kernels[i].fn;
+    _kernel = kernels[i].name;
+    return;
+  }
+  if(env)
+    fprintf(stderr, "Noyau HAAR_KERNEL=%s indisponible, noyau scalaire utilisé\n", env);
+  _stage = stageScalar;
+  _kernel = "scalar";
+}
+
+/*!\brief (re)calcule les décalages des classifieurs faibles pour des
+ * images intégrales de pas \a step (en entiers). */
+static void compileWeaks(haar_t * h, int step) {
+  const cascade_t * c = h->c;
+  unsigned int i;
+  int r;
+  h->step = step;
+  for(i = 0; i < c->nbWeaks; ++i) {
+    const cascade_feature_t * f = &c->features[c->weakFeature[i]];
+    haar_weak_t * w = &h->weaks[i];
+    memset(w->ofs, 0, sizeof w->ofs);
+    w->weight[1] = w->weight[2] = 0.0f;
+    for(r = 0; r < f->count; ++r) {
+      const cascade_rect_t * rc = &c->rects[f->first + r];
+      int * o = w->ofs[r];
+      if(f->tilted) {
+        o[0] = rc->x + rc->y * step;
+        o[1] = rc->x - rc->h + (rc->y + rc->h) * step;
+        o[2] = rc->x + rc->w + (rc->y + rc->w) * step;
+        o[3] = rc->x + rc->w - rc->h + (rc->y + rc->w + rc->h) * step;
+      } else {
+        o[0] = rc->x + rc->y * step;
+        o[1] = rc->x + rc->w + rc->y * step;
+        o[2] = rc->x + (rc->y + rc->h) * step;
+        o[3] = rc->x + rc->w + (rc->y + rc->h) * step;
+      }
+      w->weight[r] = rc->weight;
+    }
+    w->nbRects = f->count;
+    w->tilted = f->tilted;
+    w->threshold = c->weakThreshold[i];
+    w->left = c->weakLeft[i];
+    w->right = c->weakRight[i];
+  }
+  /* rectangle de normalisation, comme HaarEvaluator */
+  h->nofs[0] = 1 + step;
+  h->nofs[1] = (c->width - 1) + step;
+  h->nofs[2] = 1 + (c->height - 1) * step;
+  h->nofs[3] = (c->width - 1) + (c->height - 1) * step;
+}
+
+/*!\brief prépare l'évaluation de la cascade \a c, qui doit rester
+ * valide (projetée) tant que le résultat est utilisé.
+ *
+ * \return l'évaluateur, à libérer avec haarFree.
+ */
+haar_t * haarNew(const cascade_t * c) {
+  haar_t * h = new haar_t;
+  unsigned int i;
+  if(!_stage)
+    selectKernel();
+  h->c = c;
+  h->step = 0;
+  h->pool = NULL;
+  h->area = (double)(c->width - 2) * (c->height - 2);
+  h->weaks.resize(c->nbWeaks);
+  h->stages.resize(c->nbStages);
+  h->hasTilted = 0;
+  for(i = 0; i < c->nbFeatures; ++i)
+    h->hasTilted |= c->features[i].tilted;
+  for(i = 0; i < c->nbStages; ++i) {
+    h->stages[i].first = c->stages[i].first;
+    h->stages[i].count = c->stages[i].count;
+    /* THRESHOLD_EPS d'OpenCV */
+    h->stages[i].threshold = c->stages[i].threshold - 1e-5f;
+  }
+  return h;
+}
+
+/*!\brief tâche de conversion en niveaux de gris d'une bande de lignes
+ * (conversion pixel à pixel : le résultat est celui de l'image entière) */
+static void grayTask(void * arg) {
+  haar_stripe_t * st = (haar_stripe_t *)arg;
+  Rect r(0, st->y0, st->image->cols, st->y1 - st->y0);
+  Mat dst = st->h->grayBuf(r);
+  cvtColor((*st->image)(r), dst, COLOR_BGR2GRAY);
+}
+
+/*!\brief tâche d'un niveau : réduction de l'image puis évaluation (ou
+ * envoi à la réserve) de ses bandes. */
+static void levelTask(void * arg) {
+  haar_level_t * l = (haar_level_t *)arg;
+  haar_t * h = l->h;
+  int i;
+  /* échelle 1 : OpenCV se contente d'une copie, l'image est lue en place */
+  if(l->sz.width == h->gray.cols && l->sz.height == h->gray.rows) {
+    l->img = h->gray;
+    l->shared = 1;
+  } else {
+    /* ne jamais réduire dans l'image d'un appel précédent */
+    if(l->shared)
+      l->img = Mat();
+    l->shared = 0;
+    resize(h->gray, l->img, l->sz, 0, 0, HAAR_INTER);
+  }
+  for(i = 0; i < l->nbBands; ++i) {
+    if(h->pool)
+      poolPush(h->pool, bandTask, &h->bands[l->firstBand + i]);
+    else
+      bandTask(&h->bands[l->firstBand + i]);
+  }
+}
+
+/*!\brief tâche d'une bande : images intégrales de la bande puis
+ * évaluation de la cascade sur ses fenêtres. */
+static void bandTask(void * arg) {
+  haar_band_t * band = (haar_band_t *)arg;
+  haar_t * h = band->h;
+  const cascade_t * c = h->c;
+  const haar_level_t * l = &h->levels[band->level];
+  haar_scratch_t * sc = &h->scratch[h->pool ? poolSelf() : 0];
+  float scale = l->scale;
+  int ystep = scale >= 2 ? 1 : 2, step = h->step;
+  int nx, ny, x, y, i, k, n, rows;
+  int szw = max(l->sz.width + 1 - c->width, 0);
+  Size winSize(cvRound(c->width * scale), cvRound(c->height * scale));
+  size_t bufsize, bstep = step * sizeof(int);
+  const int * sum, * sqsum, * tilted;
+  unsigned int s;
+
+  band->objects.clear();
+  nx = (szw + ystep - 1) / ystep;
+  ny = (band->y1 - band->y0 + ystep - 1) / ystep;
+  if(!nx || !ny)
+    return;
+  /* lignes de l'image couvertes : origines de la bande plus une fenêtre */
+  rows = (ny - 1) * ystep + c->height;
+  bufsize = (size_t)step * (rows + 2);
+  if(sc->sum.size() < bufsize) {
+    sc->sum.resize(bufsize);
+    sc->sqsum.resize(bufsize);
+    if(h->hasTilted)
+      sc->tilted.resize(bufsize);
+  }
+  {
+    Mat src = l->img(Rect(0, band->y0, l->sz.width, rows));
+    Size szi(l->sz.width + 1, rows + 1);
+    Mat msum(szi, CV_32S, &sc->sum[0], bstep), msqsum(szi, CV_32S, &sc->sqsum[0], bstep);
+    if(h->hasTilted) {
+      Mat mtilted(szi, CV_32S, &sc->tilted[0], bstep);
+      integral(src, msum, msqsum, mtilted, CV_32S, CV_32S);
+    } else
+      integral(src, msum, msqsum, CV_32S, CV_32S);
+  }
+  sum = &sc->sum[0];
+  sqsum = &sc->sqsum[0];
+  tilted = h->hasTilted ? &sc->tilted[0] : sum;
+
+  sc->valid.resize(nx * ny);
+  sc->ofs[0].resize(nx * ny);
+  sc->vnf[0].resize(nx * ny);
+  sc->ofs[1].resize(nx * ny);
+  sc->vnf[1].resize(nx * ny);
+  sc->pass.resize(nx * ny);
+
+  /* normalisation par la variance de chaque fenêtre (HaarEvaluator::setWindow) */
+  for(n = 0, i = 0, y = 0; y < ny * ystep; y += ystep) {
+    for(x = 0; x < szw; x += ystep, ++i) {
+      int b = x + y * step;
+      int valsum = rectSum(sum + b, h->nofs);
+      unsigned valsqsum = (unsigned)rectSum(sqsum + b, h->nofs);
+      double nf = h->area * valsqsum - (double)valsum * valsum;
+      float vnf;
+      sc->valid[i] = 0;
+      if(nf > 0.) {
+        vnf = (float)(1. / sqrt(nf));
+        if(h->area * vnf < 1e-1) {
+          sc->valid[i] = 1;
+          sc->ofs[0][n] = b;
+          sc->vnf[0][n++] = vnf;
+        }
+      }
+    }
+  }
+
+  /* premier étage sur toutes les fenêtres valides, puis règle de saut
+     d'OpenCV : une fenêtre rejetée dès le premier étage fait sauter la
+     suivante sur la même ligne. */
+  _stage(h, &h->stages[0], sum, tilted, &sc->ofs[0][0], &sc->vnf[0][0], n, &sc->pass[0]);
+  for(k = 0, n = 0, i = 0, y = 0; y < ny; ++y) {
+    int skip = 0;
+    for(x = 0; x < nx; ++x, ++i) {
+      if(skip) {
+        skip = 0;
+        if(sc->valid[i]) ++k;
+        continue;
+      }
+      if(!sc->valid[i]) continue;
+      if(sc->pass[k]) {
+        sc->ofs[1][n] = sc->ofs[0][k];
+        sc->vnf[1][n++] = sc->vnf[0][k];
+      } else
+        skip = 1;
+      ++k;
+    }
+  }
+
+  /* étages suivants sur les seules survivantes, compactées à chaque fois */
+  for(s = 1; s < c->nbStages && n; ++s) {
+    int m = 0;
+    _stage(h, &h->stages[s], sum, tilted, &sc->ofs[1][0], &sc->vnf[1][0], n, &sc->pass[0]);
+    for(i = 0; i < n; ++i)
+      if(sc->pass[i]) {
+        sc->ofs[1][m] = sc->ofs[1][i];
+        sc->vnf[1][m++] = sc->vnf[1][i];
+      }
+    n = m;
+  }
+  for(i = 0; i < n; ++i) {
+    x = sc->ofs[1][i] % step;
+    y = band->y0 + sc->ofs[1][i] / step;
+    band->objects.push_back(Rect(cvRound(x * scale), cvRound(y * scale), winSize.width, winSize.height));
+  }
+}
+
+/*!\brief équivalent de CascadeClassifier::detectMultiScale (mêmes
+ * paramètres, mêmes rectangles à l'ordre près) pour l'image 8 bits
+ * \a image, en niveaux de gris ou BGR. */
+void haarDetect(haar_t * h, const Mat & image, vector<Rect> & objects,
+                double scaleFactor, int minNeighbors, Size minSize, Size maxSize) {
+  const cascade_t * c = h->c;
+  Size imgsz = image.size(), orig(c->width, c->height);
+  vector<float> scales;
+  double factor;
+  size_t i;
+  int bandRows, originRows, nbThreads = h->pool ? poolSize(h->pool) : 1;
+
+  assert(scaleFactor > 1 && image.depth() == CV_8U);
+  objects.clear();
+  if(image.channels() > 1 && h->pool) {
+    /* conversion répartie sur la réserve, par bandes de lignes */
+    int n = min(2 * nbThreads, imgsz.height), y;
+    h->grayBuf.create(imgsz, CV_8UC1);
+    h->stripes.resize(n);
+    for(i = 0, y = 0; i < (size_t)n; ++i) {
+      haar_stripe_t * st = &h->stripes[i];
+      st->h = h;
+      st->image = &image;
+      st->y0 = y;
+      st->y1 = y = (int)((i + 1) * imgsz.height / n);
+      poolPush(h->pool, grayTask, st);
+    }
+    poolWait(h->pool);
+    h->gray = h->grayBuf;
+  } else if(image.channels() > 1) {
+    cvtColor(image, h->grayBuf, COLOR_BGR2GRAY);
+    h->gray = h->grayBuf;
+  } else
+    h->gray = image;
+  if(maxSize.height == 0 || maxSize.width == 0)
+    maxSize = imgsz;
+  /* comme detectMultiScaleNoGrouping : échelles tant que la fenêtre
+     tient dans l'image, puis filtrage par minSize / maxSize sur
+     l'échelle en float */
+  for(factor = 1; ; factor *= scaleFactor) {
+    Size windowSize(cvRound(orig.width * factor), cvRound(orig.height * factor));
+    if(windowSize.width > imgsz.width || windowSize.height > imgsz.height)
+      break;
+    windowSize = Size(cvRound(orig.width * (float)factor), cvRound(orig.height * (float)factor));
+    if(windowSize.width > maxSize.width || windowSize.height > maxSize.height)
+      break;
+    if(windowSize.width < minSize.width || windowSize.height < minSize.height)
+      continue;
+    scales.push_back((float)factor);
+  }
+  if(scales.empty())
+    return;
+
+  /* un seul pas pour toutes les échelles : celui de la plus grande */
+  if(cvRound(imgsz.width / scales[0]) + 1 != h->step)
+    compileWeaks(h, cvRound(imgsz.width / scales[0]) + 1);
+
+  /* découpage : sans réserve une bande par niveau, sinon environ
+     HAAR_BANDS_PER_THREAD bandes par participant sur l'ensemble des
+     lignes d'origines de la pyramide, d'au moins HAAR_BAND_MIN hauteurs
+     de fenêtre ; hauteur paire pour rester alignée sur ystep. */
+  bandRows = INT_MAX;
+  if(nbThreads > 1) {
+    for(i = 0, originRows = 0; i < scales.size(); ++i)
+      originRows += max(cvRound(imgsz.height / scales[i]) + 1 - c->height, 0);
+    bandRows = (max(HAAR_BAND_MIN * c->height, originRows / (HAAR_BANDS_PER_THREAD * nbThreads)) + 1) & ~1;
+  }
+  h->levels.resize(scales.size());
+  h->bands.clear();
+  for(i = 0; i < scales.size(); ++i) {
+    haar_level_t * l = &h->levels[i];
+    int y, szw;
+    l->h = h;
+    l->scale = scales[i];
+    l->sz = Size(cvRound(imgsz.width / l->scale), cvRound(imgsz.height / l->scale));
+    l->firstBand = h->bands.size();
+    szw = max(l->sz.height + 1 - c->height, 0);
+    for(y = 0; y < szw; y += min(bandRows, szw - y)) {
+      haar_band_t b;
+      b.h = h;
+      b.level = i;
+      b.y0 = y;
+      b.y1 = y + min(bandRows, szw - y);
+      h->bands.push_back(b);
+    }
+    l->nbBands = h->bands.size() - l->firstBand;
+  }
+  h->scratch.resize(nbThreads);
+
+  /* les plus grands niveaux, les plus coûteux, sont poussés d'abord : ce
+     sont les premiers volés */
+  for(i = 0; i < h->levels.size(); ++i) {
+    if(h->pool)
+      poolPush(h->pool, levelTask, &h->levels[i]);
+    else
+      levelTask(&h->levels[i]);
+  }
+  if(h->pool)
+    poolWait(h->pool);
+
+  for(i = 0; i < h->bands.size(); ++i)
+    objects.insert(objects.end(), h->bands[i].objects.begin(), h->bands[i].objects.end());
+  groupRectangles(objects, minNeighbors, 0.2);
+}
+
+/*!\brief fait évaluer les prochains appels à haarDetect par la réserve
+ * \a pool (NULL : dans le thread appelant) ; la réserve doit survivre à
+ * l'évaluateur ou lui être retirée avant d'être libérée. */
+void haarSetPool(haar_t * h, pool_t * pool) {
+  h->pool = pool;
+}
+
+/*!\brief nom du noyau d'évaluation retenu (scalar, sse2, avx2 ou neon) */
+const char * haarKernel(void) {
+  if(!_stage)
+    selectKernel();
+  return _kernel;
+}
+
+/*!\brief libère un évaluateur (pas la cascade qu'il utilise) */
+void haarFree(haar_t * h) {
+  delete h;
+}
@@ -0,0 +1,27 @@
+/*!\file haar.h
+ *
+ * \brief évaluation vectorisée (AVX2, SSE2 ou NEON) des cascades de
+ * Haar précompilées (voir cascade.h), aux résultats identiques à ceux
+ * de CascadeClassifier::detectMultiScale.
+ */
+
+#ifndef _HAAR_H
+
+#define _HAAR_H
+
+#include <vector>
+#include <opencv2/core/core.hpp>
+#include "cascade.h"
+#include "pool.h"
+
+typedef struct haar_t haar_t;
+
+extern haar_t *     haarNew(const cascade_t * c);
+extern void         haarDetect(haar_t * h, const cv::Mat & image, std::vector<cv::Rect> & objects,
+                               double scaleFactor = 1.1, int minNeighbors = 3,
+                               cv::Size minSize = cv::Size(), cv::Size maxSize = cv::Size());
+extern void         haarSetPool(haar_t * h, pool_t * pool);
+extern const char * haarKernel(void);
+extern void         haarFree(haar_t * h);
+
+#endif
@@ -0,0 +1,103 @@
+/*!\file haarbench.cpp
+ *
+ * \brief micro-benchmark : CascadeClassifier::detectMultiScale
+ * d'OpenCV contre haarDetect (haar.cpp) sur une même image, avec les
+ * paramètres de window.cpp, et vérification que les détections sont
+ * identiques. La référence OpenCV lit directement le .xml livré, et
+ * haarDetect le binaire compilé (cascade.cpp) : une erreur de
+ * compilation de la cascade se voit donc aussi.
+ *
+ * Usage : haarbench image [itérations [threads]]
+ *
+ * OpenCV et haarDetect disposent du même nombre de threads (1 par
+ * défaut, pour comparer les noyaux à ressources égales ; 0 : autant
+ * que de cœurs) ; HAAR_KERNEL permet de choisir le noyau de
+ * haarDetect.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/objdetect.hpp>
+#include "cascade.h"
+#include "haar.h"
+#include "pool.h"
+
+using namespace cv;
+using namespace std;
+
+static bool rectLess(const Rect & a, const Rect & b) {
+  if(a.x != b.x) return a.x < b.x;
+  if(a.y != b.y) return a.y < b.y;
+  if(a.width != b.width) return a.width < b.width;
+  return a.height < b.height;
+}
+
+/*!\brief chronomètre les deux détecteurs sur \a img ; renvoie 0 si
+ * leurs détections sont identiques (à l'ordre près). */
+static int bench(const char * xmlname, const Mat & img, double scaleFactor, int minNeighbors,
+                 int iterations, pool_t * pool) {
+  CascadeClassifier cc;
+  cascade_t * c = NULL;
+  haar_t * h;
+  vector<Rect> ref, got;
+  int64 t;
+  double tcv, thaar;
+  int i, same;
+
+  if(!cc.load(xmlname) || cc.empty() || !(c = cascadeLoad(xmlname))) {
+    fprintf(stderr, "Impossible de charger la cascade %s\n", xmlname);
+    cascadeFree(c);
+    return -1;
+  }
+  h = haarNew(c);
+  haarSetPool(h, pool);
+
+  cc.detectMultiScale(img, ref, scaleFactor, minNeighbors);
+  t = getTickCount();
+  for(i = 0; i < iterations; ++i)
+    cc.detectMultiScale(img, ref, scaleFactor, minNeighbors);
+  tcv = (getTickCount() - t) * 1000.0 / getTickFrequency() / iterations;
+
+  haarDetect(h, img, got, scaleFactor, minNeighbors);
+  t = getTickCount();
+  for(i = 0; i < iterations; ++i)
+    haarDetect(h, img, got, scaleFactor, minNeighbors);
+  thaar = (getTickCount() - t) * 1000.0 / getTickFrequency() / iterations;
+
+  sort(ref.begin(), ref.end(), rectLess);
+  sort(got.begin(), got.end(), rectLess);
+  same = ref == got;
+  printf("%-40s OpenCV %8.2f ms  haar (%s) %8.2f ms  x%.2f  %zu/%zu détections %s\n",
+         xmlname, tcv, haarKernel(), thaar, tcv / thaar, ref.size(), got.size(),
+         same ? "identiques" : "DIFFÉRENTES");
+
+  haarFree(h);
+  cascadeFree(c);
+  return same ? 0 : 1;
+}
+
+int main(int argc, char ** argv) {
+  Mat img;
+  pool_t * pool = NULL;
+  int iterations = argc > 2 ? atoi(argv[2]) : 20, nbThreads = argc > 3 ? atoi(argv[3]) : 1, r = 0;
+  if(argc < 2 || iterations <= 0 || nbThreads < 0) {
+    fprintf(stderr, "Usage : %s image [itérations [threads]]\n", argv[0]);
+    return 2;
+  }
+  if((img = imread(argv[1], IMREAD_COLOR)).empty()) {
+    fprintf(stderr, "Impossible de lire l'image %s\n", argv[1]);
+    return 2;
+  }
+  if(nbThreads != 1)
+    pool = poolNew(nbThreads);
+  setNumThreads(pool ? poolSize(pool) : 1);
+  printf("%s : %dx%d, %d itérations, %d threads\n", argv[1], img.cols, img.rows, iterations,
+         pool ? poolSize(pool) : 1);
+  r |= bench("haarcascade_frontalface_default.xml", img, 1.2, 5, iterations, pool);
+  r |= bench("Nariz.xml", img, 1.3, 10, iterations, pool);
+  poolFree(pool);
+  return r ? 1 : 0;
+}
@@ -0,0 +1,170 @@
+/*!\file pool.cpp
+ *
+ * \brief réserve de threads à vol de tâches (work stealing).
+ *
+ * Chaque participant (les threads de la réserve, plus le thread qui
+ * appelle poolWait, d'indice 0) possède sa file de tâches. Il dépile
+ * ses propres tâches par la fin (les plus récentes, encore chaudes en
+ * cache) et, quand sa file est vide, vole les plus anciennes, donc en
+ * général les plus grosses, au début de la file d'un autre. Une tâche
+ * peut en pousser d'autres : elles arrivent dans la file de celui qui
+ * l'exécute. Les participants sans travail dorment jusqu'au prochain
+ * poolPush.
+ */
+
+#include <assert.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "pool.h"
+
+using namespace std;
+
+typedef struct pool_task_t {
+  pool_task_fn_t fn;
+  void * arg;
+} pool_task_t;
+
+/*!\brief file d'un participant */
+typedef struct pool_queue_t {
+  mutex m;
+  deque<pool_task_t> q;
+} pool_queue_t;
+
+struct pool_t {
+  int n;
+  pool_queue_t * queues;
+  vector<thread> threads;
+  /* tâches en file (pas encore commencées) et tâches non terminées */
+  atomic<int> queued, pending;
+  atomic<bool> quit;
+  mutex m;
+  condition_variable cv;
+};
+
+/*!\brief indice du participant courant dans sa réserve (0 hors réserve) */
+static thread_local int _self = 0;
+
+static bool take(pool_t * p, pool_task_t * t);
+static void run(pool_t * p, const pool_task_t * t);
+static void worker(pool_t * p, int self);
+
+/*!\brief prend une tâche : à la fin de sa propre file, sinon au début
+ * de celle d'un autre participant. */
+static bool take(pool_t * p, pool_task_t * t) {
+  int i;
+  for(i = 0; i < p->n; ++i) {
+    pool_queue_t * q = &p->queues[(_self + i) % p->n];
+    lock_guard<mutex> lk(q->m);
+    if(q->q.empty())
+      continue;
+    if(i == 0) {
+      *t = q->q.back();
+      q->q.pop_back();
+    } else {
+      *t = q->q.front();
+      q->q.pop_front();
+    }
+    --p->queued;
+    return true;
+  }
+  return false;
+}
+
+static void run(pool_t * p, const pool_task_t * t) {
+  t->fn(t->arg);
+  if(--p->pending == 0) {
+    lock_guard<mutex> lk(p->m);
+    p->cv.notify_all();
+  }
+}
+
+static void worker(pool_t * p, int self) {
+  pool_task_t t;
+  _self = self;
+  while(!p->quit) {
+    if(take(p, &t)) {
+      run(p, &t);
+      continue;
+    }
+    unique_lock<mutex> lk(p->m);
+    p->cv.wait(lk, [p] { return p->quit || p->queued > 0; });
+  }
+}
+
+/*!\brief crée une réserve de \a nbThreads participants en comptant le
+ * thread appelant de poolWait (0 : autant que de cœurs).
+ */
+pool_t * poolNew(int nbThreads) {
+  pool_t * p = new pool_t;
+  int i;
+  if(nbThreads <= 0)
+    nbThreads = max(1, (int)thread::hardware_concurrency());
+  p->n = nbThreads;
+  p->queues = new pool_queue_t[p->n];
+  p->queued = 0;
+  p->pending = 0;
+  p->quit = false;
+  for(i = 1; i < p->n; ++i)
+    p->threads.push_back(thread(worker, p, i));
+  return p;
+}
+
+/*!\brief ajoute la tâche fn(arg) à la file du participant courant. */
+void poolPush(pool_t * p, pool_task_fn_t fn, void * arg) {
+  pool_queue_t * q = &p->queues[_self < p->n ? _self : 0];
+  pool_task_t t = { fn, arg };
+  ++p->pending;
+  {
+    lock_guard<mutex> lk(q->m);
+    q->q.push_back(t);
+  }
+  ++p->queued;
+  lock_guard<mutex> lk(p->m);
+  p->cv.notify_one();
+}
+
+/*!\brief participe à l'exécution des tâches jusqu'à ce qu'elles soient
+ * toutes terminées, y compris celles poussées en cours de route. Un
+ * seul thread extérieur à la fois doit l'appeler.
+ */
+void poolWait(pool_t * p) {
+  pool_task_t t;
+  assert(_self == 0);
+  while(p->pending > 0) {
+    if(take(p, &t)) {
+      run(p, &t);
+      continue;
+    }
+    unique_lock<mutex> lk(p->m);
+    p->cv.wait(lk, [p] { return p->pending == 0 || p->queued > 0; });
+  }
+}
+
+/*!\brief nombre de participants, thread appelant de poolWait compris */
+int poolSize(const pool_t * p) {
+  return p->n;
+}
+
+/*!\brief indice (de 0 à poolSize - 1) du participant courant */
+int poolSelf(void) {
+  return _self;
+}
+
+void poolFree(pool_t * p) {
+  size_t i;
+  if(!p) return;
+  {
+    lock_guard<mutex> lk(p->m);
+    p->quit = true;
+    p->cv.notify_all();
+  }
+  for(i = 0; i < p->threads.size(); ++i)
+    p->threads[i].join();
+  delete[] p->queues;
+  delete p;
+}
@@ -0,0 +1,20 @@
+/*!\file pool.h
+ *
+ * \brief réserve de threads à vol de tâches (work stealing).
+ */
+
+#ifndef _POOL_H
+
+#define _POOL_H
+
+typedef struct pool_t pool_t;
+typedef void (*pool_task_fn_t)(void * arg);
+
+extern pool_t * poolNew(int nbThreads);
+extern void     poolPush(pool_t * p, pool_task_fn_t fn, void * arg);
+extern void     poolWait(pool_t * p);
+extern int      poolSize(const pool_t * p);
+extern int      poolSelf(void);
+extern void     poolFree(pool_t * p);
+
+#endif
@@ -10,13 +10,18 @@
 #include <GL4D/gl4duw_SDL2.h>
 #include <SDL2/SDL_image.h>
 #include "assimp.h"
+#include "cascade.h"
+#include "haar.h"
+#include "pool.h"
 
 using namespace cv;
 using namespace std;
 
-static CascadeClassifier * face_cc;
-static CascadeClassifier * eye_cc;
-static CascadeClassifier * nose_cc;
+/*!\brief cascades précompilées (projetées en mémoire) et leurs évaluateurs */
+static cascade_t * face_c = NULL, * nose_c = NULL;
+static haar_t * face_h = NULL, * nose_h = NULL;
+/*!\brief réserve de threads de la détection des visages (tuiles et échelles) */
+static pool_t * _pool = NULL;
 
 static Mat cameraFrame;
 
@@ -130,15 +135,20 @@ static void initData(void) {
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
   
-  face_cc = new CascadeClassifier("haarcascade_frontalface_default.xml");
-  eye_cc = new CascadeClassifier("haarcascade_eye.xml");
-  nose_cc = new CascadeClassifier("Nariz.xml");
-
-
-  if(face_cc == NULL || eye_cc == NULL || nose_cc == NULL){
-    cout << "impossible d'ouvrir les .xml";
-    return;
+  /* cascades précompilées (.bin à côté des .xml), voir cascade.cpp */
+  if(!(face_c = cascadeLoad("haarcascade_frontalface_default.xml")) ||
+     !(nose_c = cascadeLoad("Nariz.xml"))) {
+    fprintf(stderr, "Impossible de charger les cascades de détection\n");
+    exit(2);
   }
+  face_h = haarNew(face_c);
+  nose_h = haarNew(nose_c);
+  /* visages sur toute l'image : tuiles et échelles réparties sur tous
+     les cœurs ; le nez, cherché dans un petit rectangle, reste dans le
+     thread principal */
+  _pool = poolNew(0);
+  haarSetPool(face_h, _pool);
+  fprintf(stderr, "Noyau d'évaluation des cascades : %s, %d threads\n", haarKernel(), poolSize(_pool));
   camera = new VideoCapture(0);
   if(!camera || !camera->isOpened()) {
     delete camera;
@@ -213,7 +223,7 @@ static void draw(void) {
   const GLfloat blanc[] = {1.0f, 1.0f, 1.0f, 1.0f};
   *camera >> cameraFrame;
   vector<Rect> faces;
- face_cc->detectMultiScale(cameraFrame, faces, 1.2, 5);
+ haarDetect(face_h, cameraFrame, faces, 1.2, 5);
  
   glBindTexture(GL_TEXTURE_2D, _tId);
  
@@ -247,7 +257,7 @@ static void draw(void) {
     assimpObjet(ip[0]+70, ip[1]+35, (GLfloat)(((*fc).width*(*fc).height)/1000)-250, -10, 0);
     Mat cameraFrame_roi = cameraFrame(*fc);
     vector<Rect> noses;      
-    nose_cc->detectMultiScale(cameraFrame_roi, noses, 1.3, 10);
+    haarDetect(nose_h, cameraFrame_roi, noses, 1.3, 10);
     for(vector<Rect>::iterator nc = noses.begin(); nc != noses.end(); ++nc){
       translate_coord(ip, (int)((*nc).tl()).x, (int)((*nc).tl()).y); 
       assimpObjet(ip[0]+22, ip[1]+15, (GLfloat)(((*nc).width*(*nc).height)/1000)-150, -10, 1);
@@ -271,6 +281,11 @@ static void quit(void) {
     glDeleteBuffers(1, &_buffer);
   if(_tId)
     glDeleteTextures(1, &_tId);
+  haarFree(face_h);
+  haarFree(nose_h);
+  poolFree(_pool);
+  cascadeFree(face_c);
+  cascadeFree(nose_c);
   if(_oglContext)
     SDL_GL_DeleteContext(_oglContext);
   if(_win)